@@ -0,0 +1,824 @@
+#include "kevlar.h"
+#include <random>
+#include <new>
+#include <pthread.h>
+
+void
+print_m128i(const char *varname, __m128i value)
+{
+    uint8_t bytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), value);
+
+    printf("%s: ", varname);
+    for (int i = 0; i < 16; i++) {
+        printf("%02x", bytes[i]);  // Print as hexadecimal
+    }
+    printf("\n");
+}
+
+namespace kevlar {
+
+__m128i ephemeral_enc_keys[11];
+__m128i ephemeral_key;
+bool ephemeral_key_initialized = false;
+
+SaltLeaseTable *salt_leases = nullptr;
+uint32_t salt_lease = 0;
+
+uint64_t nh_keys[KEVLAR_BYTES_CHUNK / 8];
+
+// Macro for AES-128 key expansion step. RC must be an immediate constant.
+#define AES128_KEY_EXPANSION_STEP(KEY, RC) ({                      \
+    __m128i _key = (KEY);                                          \
+    __m128i _temp = _mm_aeskeygenassist_si128(_key, (RC));         \
+    _temp = _mm_shuffle_epi32(_temp, _MM_SHUFFLE(3,3,3,3));          \
+    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
+    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
+    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
+    _mm_xor_si128(_key, _temp);                                      \
+})
+
+#define _my_rdrand64_step(x) ({ unsigned char err; asm volatile(".byte 0x48; .byte 0x0f; .byte 0xc7; .byte 0xf0; setc %1":"=a"(*x), "=qm"(err)); err; })
+
+// Take the next lease from the domain's allocator, skipping lease 0 when the allocator wraps.
+static uint32_t
+take_salt_lease(void)
+{
+    uint32_t lease;
+    do
+        lease = salt_leases->next_lease.fetch_add(1) % KEVLAR_SALT_LEASES;
+    while (lease == 0);
+    return lease;
+}
+
+extern "C" void
+renew_salt_lease(void)
+{
+    salt_lease = take_salt_lease();
+    g_key9 = _mm_set_epi32(0, 0, salt_lease << KEVLAR_SALT_COUNTER_BITS, 0);
+}
+
+extern "C" void
+restore_key_registers(void)
+{
+    g_key0 = ephemeral_enc_keys[0];
+    g_key1 = ephemeral_enc_keys[1];
+    g_key2 = ephemeral_enc_keys[2];
+    g_key3 = ephemeral_enc_keys[3];
+    g_key4 = ephemeral_enc_keys[4];
+    g_key5 = ephemeral_enc_keys[5];
+    g_key6 = ephemeral_enc_keys[6];
+    g_key7 = ephemeral_enc_keys[7];
+    g_key10 = ephemeral_enc_keys[10];
+
+    g_key8 = _mm_set_epi32(0, 0, 1, 0);
+
+    // the salt counter only lives in xmm14: keep it if the register still holds our lease and nothing
+    // else, otherwise it was clobbered and we cannot tell which salts were used, so move to a new lease
+    __m128i lease_mask = _mm_set_epi32(-1, -1, ~((1u << KEVLAR_SALT_COUNTER_BITS) - 1), -1);
+    __m128i expected = _mm_set_epi32(0, 0, salt_lease << KEVLAR_SALT_COUNTER_BITS, 0);
+    __m128i salt = g_key9;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(salt, lease_mask), expected)) != 0xffff)
+        renew_salt_lease();
+}
+
+// pthread_atfork() handlers: the parent just re-pins its keys, the child also takes a salt lease of its
+// own.
+static void
+salt_lease_atfork_parent(void)
+{
+    restore_key_registers();
+}
+
+static void
+salt_lease_atfork_child(void)
+{
+    renew_salt_lease();
+    restore_key_registers();
+}
+
+extern "C" void
+init_ephemeral_key(void)
+{
+    if (!ephemeral_key_initialized) {
+        int success;
+        long long unsigned rdrand_value;
+        while (!(success =  _my_rdrand64_step(&rdrand_value)));
+        // printf("rdrand_value = 0x%lx\n", (uint64_t)rdrand_value);
+        std::mt19937 gen((uint64_t)rdrand_value);
+        std::uniform_int_distribution<uint32_t> dis;
+        uint32_t randomParts[4] = { dis(gen), dis(gen), dis(gen), dis(gen) };
+        // printf("randomParts[] = { %08x, %08x, %08x, %08x }\n", randomParts[3], randomParts[2], randomParts[1], randomParts[0]);
+        ephemeral_key = _mm_set_epi32(randomParts[3], randomParts[2], randomParts[1], randomParts[0]);
+
+        ephemeral_enc_keys[0] = ephemeral_key;
+        ephemeral_enc_keys[1] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[0], 0x01);
+        ephemeral_enc_keys[2] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[1], 0x02);
+        ephemeral_enc_keys[3] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[2], 0x04);
+        ephemeral_enc_keys[4] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[3], 0x08);
+        ephemeral_enc_keys[5] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[4], 0x10);
+        ephemeral_enc_keys[6] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[5], 0x20);
+        ephemeral_enc_keys[7] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[6], 0x40);
+        ephemeral_enc_keys[8] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[7], 0x80);
+        ephemeral_enc_keys[9] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[8], 0x1B);
+        ephemeral_enc_keys[10] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[9], 0x36);
+
+        // Bind the first 10 keys to XMM registers.
+        g_key0 = ephemeral_enc_keys[0];
+        g_key1 = ephemeral_enc_keys[1];
+        g_key2 = ephemeral_enc_keys[2];
+        g_key3 = ephemeral_enc_keys[3];
+        g_key4 = ephemeral_enc_keys[4];
+        g_key5 = ephemeral_enc_keys[5];
+        g_key6 = ephemeral_enc_keys[6];
+        g_key7 = ephemeral_enc_keys[7];
+        g_key8 = ephemeral_enc_keys[8];
+        g_key9 = ephemeral_enc_keys[9];
+        g_key10 = ephemeral_enc_keys[10];
+
+        // the lease allocator is shared by every process forked from here on
+        void *lease_page = mmap(nullptr, sizeof(SaltLeaseTable), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (lease_page == MAP_FAILED) {
+            printf("Salt lease table mmap() failed...\n");
+            abort();
+        }
+        salt_leases = new (lease_page) SaltLeaseTable();
+
+        // xmm14 is the incrementing salt value
+        renew_salt_lease();
+
+        // xmm13 is the incrementor value
+        __m128i salt_increment = _mm_set_epi32(0, 0, 1, 0);
+        g_key8 = salt_increment;
+
+        pthread_atfork(nullptr, salt_lease_atfork_parent, salt_lease_atfork_child);
+
+        derive_nh_keys();
+
+#if 0
+        for (unsigned i=0; i <= 10; i++)
+          print_m128i("key[]", ephemeral_enc_keys[i]);
+        ephemeral_key_initialized = true;
+#endif
+    }
+}
+
+// --- SharedDomain ---
+
+SharedDomain *
+SharedDomain::create(size_t arena_bytes)
+{
+    if (arena_bytes > SIZE_MAX - header_bytes - 15)
+        return nullptr;
+    size_t bytes = header_bytes + ((arena_bytes + 15) & ~size_t(15));
+    void *mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+    return new (mapping) SharedDomain(bytes - header_bytes, bytes);
+}
+
+void *
+SharedDomain::allocate(size_t bytes)
+{
+    if (bytes > capacity)
+        return nullptr;
+    bytes = (bytes + 15) & ~size_t(15);
+    size_t offset = used.load();
+    do {
+        if (bytes > capacity - offset)
+            return nullptr;
+    } while (!used.compare_exchange_weak(offset, offset + bytes));
+    return arena() + offset;
+}
+
+EncIntArray
+SharedDomain::make_array(size_t n)
+{
+    restore_key_registers();
+    if (n > SIZE_MAX / sizeof(EncInt))
+        return EncIntArray();
+    EncInt *elems = static_cast<EncInt *>(allocate(n * sizeof(EncInt)));
+    if (!elems)
+        return EncIntArray();
+    for (size_t i = 0; i < n; i++)
+        new (&elems[i]) EncInt();
+    return EncIntArray(elems, n);
+}
+
+// --- EncBytes ---
+
+extern "C" void
+derive_nh_keys(void)
+{
+    for (size_t i = 0; i < KEVLAR_BYTES_CHUNK / 16; i++) {
+        __m128i block = _mm_set_epi64x(i, KEVLAR_NH_COOKIE);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&nh_keys[2 * i]), AES_128_Enc_Raw(block));
+    }
+}
+
+void
+wipe_bytes(void *p, size_t n)
+{
+    memset(p, 0, n);
+    __asm__ volatile ("" : : "r" (p) : "memory");
+}
+
+__m128i
+next_bytes_nonce(void)
+{
+    uint64_t n = salt_leases->bytes_nonce.fetch_add(1);
+    return _mm_set_epi64x(n >> 56, n << 8);
+}
+
+// XOR len bytes of keystream into out, starting at block counter ctr. in and out may alias.
+static void
+ctr_xor(__m128i base, uint64_t ctr, const uint8_t *in, uint8_t *out, size_t len)
+{
+    // the block counter goes in the 56-bit field above the top of the nonce
+    uint64_t high = _mm_extract_epi64(base, 1);
+
+    // four counter blocks in flight, xmm4 stages the data
+    while (len >= 64) {
+        __m128i b0 = _mm_insert_epi64(base, high | ctr << 8, 1);
+        __m128i b1 = _mm_insert_epi64(base, high | (ctr + 1) << 8, 1);
+        __m128i b2 = _mm_insert_epi64(base, high | (ctr + 2) << 8, 1);
+        __m128i b3 = _mm_insert_epi64(base, high | (ctr + 3) << 8, 1);
+        __asm__ volatile (
+            KEVLAR_AES_ENC4
+            "movdqu   (%4), %%xmm4   \n\t"
+            "pxor     %%xmm4, %0     \n\t"
+            "movdqu   %0, (%5)       \n\t"
+            "movdqu 16(%4), %%xmm4   \n\t"
+            "pxor     %%xmm4, %1     \n\t"
+            "movdqu   %1, 16(%5)     \n\t"
+            "movdqu 32(%4), %%xmm4   \n\t"
+            "pxor     %%xmm4, %2     \n\t"
+            "movdqu   %2, 32(%5)     \n\t"
+            "movdqu 48(%4), %%xmm4   \n\t"
+            "pxor     %%xmm4, %3     \n\t"
+            "movdqu   %3, 48(%5)     \n\t"
+            : "+x" (b0), "+x" (b1), "+x" (b2), "+x" (b3)
+            : "r" (in), "r" (out)
+            : "xmm4", "memory"
+        );
+        ctr += 4;
+        in += 64;
+        out += 64;
+        len -= 64;
+    }
+    while (len) {
+        uint8_t pad[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pad), AES_128_Enc_Raw(_mm_insert_epi64(base, high | ctr++ << 8, 1)));
+        size_t n = len < 16 ? len : 16;
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i] ^ pad[i];
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+// NH universal hash of one chunk of ciphertext, the trailing partial block is zero padded.
+static uint128_t
+nh_hash(const uint8_t *c, size_t len)
+{
+    uint128_t sum = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint64_t m0, m1;
+        memcpy(&m0, c + i, 8);
+        memcpy(&m1, c + i + 8, 8);
+        sum += static_cast<uint128_t>(m0 + nh_keys[i / 8]) * (m1 + nh_keys[i / 8 + 1]);
+    }
+    if (i < len) {
+        uint64_t last[2] = { 0, 0 };
+        memcpy(last, c + i, len - i);
+        sum += static_cast<uint128_t>(last[0] + nh_keys[i / 8]) * (last[1] + nh_keys[i / 8 + 1]);
+    }
+    return sum;
+}
+
+// Tag for chunk number chunk of a stream: NH(ciphertext) + E(pad).
+static __m128i
+chunk_tag(__m128i nonce, uint64_t chunk, bool final, size_t len, const uint8_t *c)
+{
+    uint64_t field = chunk | static_cast<uint64_t>(final) << 34 | static_cast<uint64_t>(len) << 35;
+    __m128i pad = _mm_or_si128(nonce, _mm_set_epi64x(field << 8, KEVLAR_TAG_COOKIE));
+    pad = AES_128_Enc_Raw(pad);
+    uint128_t tag = nh_hash(c, len)
+        + (static_cast<uint128_t>(_mm_extract_epi64(pad, 1)) << 64 | static_cast<uint64_t>(_mm_extract_epi64(pad, 0)));
+    return _mm_set_epi64x(static_cast<uint64_t>(tag >> 64), static_cast<uint64_t>(tag));
+}
+
+// Constant-time 128-bit equality.
+static bool
+blocks_equal(__m128i a, __m128i b)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xffff;
+}
+
+void
+ByteStream::seal(const uint8_t *in, uint8_t *out, size_t len, ChunkTag *tags, bool final)
+{
+    restore_key_registers();
+    assert(final || len % KEVLAR_BYTES_CHUNK == 0);
+    size_t ntags = tag_count(len, final);
+    assert(chunk + ntags <= KEVLAR_BYTES_MAX_CHUNKS);
+    for (size_t t = 0; t < ntags; t++) {
+        size_t n = len < KEVLAR_BYTES_CHUNK ? len : KEVLAR_BYTES_CHUNK;
+        ctr_xor(ctr_base(), chunk * (KEVLAR_BYTES_CHUNK / 16), in, out, n);
+        tags[t].value = chunk_tag(nonce, chunk, final && t == ntags - 1, n, out);
+        chunk++;
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+bool
+ByteStream::open(const uint8_t *in, uint8_t *out, size_t len, const ChunkTag *tags, bool final)
+{
+    restore_key_registers();
+    assert(final || len % KEVLAR_BYTES_CHUNK == 0);
+    size_t ntags = tag_count(len, final);
+    assert(chunk + ntags <= KEVLAR_BYTES_MAX_CHUNKS);
+    for (size_t t = 0; t < ntags; t++) {
+        size_t n = len < KEVLAR_BYTES_CHUNK ? len : KEVLAR_BYTES_CHUNK;
+        if (!blocks_equal(tags[t].value, chunk_tag(nonce, chunk, final && t == ntags - 1, n, in))) {
+            printf("Authentication failure...\n");
+            return false;
+        }
+        ctr_xor(ctr_base(), chunk * (KEVLAR_BYTES_CHUNK / 16), in, out, n);
+        chunk++;
+        in += n;
+        out += n;
+        len -= n;
+    }
+    return true;
+}
+
+void
+EncBytes::seal_from(const uint8_t *p, size_t n)
+{
+    restore_key_registers();
+    cipher.resize(n);
+    tags.resize(ByteStream::tag_count(n));
+    ByteStream stream;
+    nonce = stream.get_nonce();
+    stream.seal(p, cipher.data(), n, tags.data());
+}
+
+void
+EncBytes::reseal_from(const EncBytes &other)
+{
+    restore_key_registers();
+    size_t n = other.cipher.size();
+    std::vector<uint8_t> fresh(n);
+    std::vector<ChunkTag> fresh_tags(ByteStream::tag_count(n));
+    ByteStream src(other.nonce), dst;
+    for (size_t t = 0, off = 0; t < fresh_tags.size(); t++, off += KEVLAR_BYTES_CHUNK) {
+        size_t len = n - off < KEVLAR_BYTES_CHUNK ? n - off : KEVLAR_BYTES_CHUNK;
+        bool final = t == fresh_tags.size() - 1;
+        if (!src.open(other.cipher.data() + off, fresh.data() + off, len, &other.tags[t], final)) {
+            // keep the tampered original as is, so the copy fails authentication just like it
+            cipher = other.cipher;
+            tags = other.tags;
+            nonce = other.nonce;
+            return;
+        }
+        dst.seal(fresh.data() + off, fresh.data() + off, len, &fresh_tags[t], final);
+    }
+    cipher.swap(fresh);
+    tags.swap(fresh_tags);
+    nonce = dst.get_nonce();
+}
+
+bool
+EncBytes::decrypt(ByteSpan out) const
+{
+    restore_key_registers();
+    assert(out.size >= cipher.size());
+    ByteStream stream(nonce);
+    if (!stream.open(cipher.data(), out.data, cipher.size(), tags.data())) {
+        wipe_bytes(out.data, cipher.size());
+        return false;
+    }
+    return true;
+}
+
+bool
+EncBytes::equals(const void *p, size_t n) const
+{
+    restore_key_registers();
+    if (n != cipher.size())
+        return false;
+    const uint8_t *other = static_cast<const uint8_t *>(p);
+    uint8_t chunk[KEVLAR_BYTES_CHUNK] = {};  // a chunk failing authentication is compared as zeros
+    ByteStream stream(nonce);
+    uint8_t diff = 0;
+    bool auth = true;
+    for (size_t t = 0, off = 0; t < tags.size(); t++, off += KEVLAR_BYTES_CHUNK) {
+        size_t len = n - off < KEVLAR_BYTES_CHUNK ? n - off : KEVLAR_BYTES_CHUNK;
+        auth = stream.open(cipher.data() + off, chunk, len, &tags[t], t == tags.size() - 1) && auth;
+        for (size_t i = 0; i < len; i++)
+            diff |= chunk[i] ^ other[off + i];
+    }
+    wipe_bytes(chunk, sizeof(chunk));
+    return auth && diff == 0;
+}
+
+bool
+ct_equal(const EncBytes &a, const EncBytes &b)
+{
+    restore_key_registers();
+    if (a.cipher.size() != b.cipher.size())
+        return false;
+    size_t n = a.cipher.size();
+    uint8_t chunk_a[KEVLAR_BYTES_CHUNK] = {}, chunk_b[KEVLAR_BYTES_CHUNK] = {};
+    ByteStream stream_a(a.nonce), stream_b(b.nonce);
+    uint8_t diff = 0;
+    bool auth = true;
+    for (size_t t = 0, off = 0; t < a.tags.size(); t++, off += KEVLAR_BYTES_CHUNK) {
+        size_t len = n - off < KEVLAR_BYTES_CHUNK ? n - off : KEVLAR_BYTES_CHUNK;
+        bool final = t == a.tags.size() - 1;
+        auth = stream_a.open(a.cipher.data() + off, chunk_a, len, &a.tags[t], final) && auth;
+        auth = stream_b.open(b.cipher.data() + off, chunk_b, len, &b.tags[t], final) && auth;
+        for (size_t i = 0; i < len; i++)
+            diff |= chunk_a[i] ^ chunk_b[i];
+    }
+    wipe_bytes(chunk_a, sizeof(chunk_a));
+    wipe_bytes(chunk_b, sizeof(chunk_b));
+    return auth && diff == 0;
+}
+
+// --- Batched EncInt Cipher ---
+
+bool
+decrypt_batch(const __m128i *blocks, uint64_t *values, size_t n, bool *valid)
+{
+    restore_key_registers();
+    bool auth = true;
+    for (size_t i = 0; i < n; i += 4) {
+        size_t m = n - i < 4 ? n - i : 4;
+        __m128i b[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (size_t j = 0; j < m; j++)
+            b[j] = blocks[i + j];
+        AES_128_Dec_Raw4(b);
+        for (size_t j = 0; j < m; j++) {
+            // check the authentication "cookie"
+            bool cookie = _mm_cvtsi128_si32(b[j]) == 0x2a;
+            auth &= cookie;
+            if (valid)
+                valid[i + j] = cookie;
+            values[i + j] = _mm_extract_epi64(b[j], 1);
+        }
+    }
+    if (!auth)
+        printf("Authentication failure...\n");
+    return auth;
+}
+
+void
+encrypt_batch(const uint64_t *values, __m128i *blocks, size_t n)
+{
+    restore_key_registers();
+    for (size_t i = 0; i < n; i += 4) {
+        size_t m = n - i < 4 ? n - i : 4;
+        __m128i b[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (size_t j = 0; j < m; j++)
+            b[j] = _mm_add_epi32(_mm_set_epi64x(values[i + j], /* hash */42), next_salt_block());
+        AES_128_Enc_Raw4(b);
+        for (size_t j = 0; j < m; j++)
+            blocks[i + j] = b[j];
+    }
+}
+
+// --- EncHashMap ---
+
+// Keyed-PRF tags for n plaintext keys, pipelined four at a time.
+static void
+prf_tags(const uint64_t *keys, uint64_t *tags, size_t n)
+{
+    for (size_t i = 0; i < n; i += 4) {
+        size_t m = n - i < 4 ? n - i : 4;
+        __m128i b[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (size_t j = 0; j < m; j++)
+            b[j] = _mm_set_epi64x(keys[i + j], KEVLAR_PRF_COOKIE);
+        AES_128_Enc_Raw4(b);
+        for (size_t j = 0; j < m; j++)
+            tags[i + j] = static_cast<uint64_t>(_mm_cvtsi128_si64(b[j])) | 1;
+    }
+}
+
+EncHashMap::EncHashMap(size_t capacity)
+    : count(0)
+{
+    size_t slots = 16;
+    while (slots < capacity)
+        slots <<= 1;
+    tags.assign(slots, 0);
+    keys.resize(slots);
+    values.resize(slots);
+}
+
+// Grow (doubling) until n more keys fit under a 3/4 load factor. Slots are placed by tag alone, so the
+// ciphertexts move across without being decrypted.
+void
+EncHashMap::reserve_for(size_t n)
+{
+    size_t slots = tags.size();
+    while ((count + n) * 4 > slots * 3)
+        slots <<= 1;
+    if (slots == tags.size())
+        return;
+
+    std::vector<uint64_t> new_tags(slots, 0);
+    std::vector<StoredBlock> new_keys(slots), new_values(slots);
+    for (size_t i = 0; i < tags.size(); i++) {
+        if (!tags[i])
+            continue;
+        size_t j = (tags[i] >> 1) & (slots - 1);
+        while (new_tags[j])
+            j = (j + 1) & (slots - 1);
+        new_tags[j] = tags[i];
+        new_keys[j].encrypted_state = keys[i].encrypted_state;
+        new_values[j].encrypted_state = values[i].encrypted_state;
+    }
+    tags.swap(new_tags);
+    keys.swap(new_keys);
+    values.swap(new_values);
+}
+
+// Slot holding key, or the empty slot ending its probe sequence. Stored keys are decrypted only on a
+// tag match; one that fails authentication never matches and clears auth.
+size_t
+EncHashMap::probe(uint64_t tag, uint64_t key, bool &auth) const
+{
+    size_t mask = tags.size() - 1;
+    for (size_t i = home(tag);; i = (i + 1) & mask) {
+        if (!tags[i])
+            return i;
+        if (tags[i] == tag) {
+            uint64_t stored;
+            bool valid = decrypt_batch(&keys[i].encrypted_state, &stored, 1);
+            auth &= valid;
+            if (valid && stored == key)
+                return i;
+        }
+    }
+}
+
+bool
+EncHashMap::insert(const EncInt &key, const EncInt &value)
+{
+    size_t inserted;
+    return insert_batch(&key, &value, 1, &inserted) && inserted == 1;
+}
+
+bool
+EncHashMap::find(const EncInt &key, EncInt &value) const
+{
+    bool found;
+    return find_batch(&key, &value, &found, 1) && found;
+}
+
+bool
+EncHashMap::insert_batch(const EncInt *in_keys, const EncInt *in_values, size_t n, size_t *inserted)
+{
+    restore_key_registers();
+    bool auth = true;
+    size_t new_keys = 0;
+    uint64_t plain_keys[KEVLAR_BATCH], plain_values[KEVLAR_BATCH], tag[KEVLAR_BATCH];
+    __m128i key_blocks[KEVLAR_BATCH], value_blocks[KEVLAR_BATCH];
+    bool key_valid[KEVLAR_BATCH], value_valid[KEVLAR_BATCH];
+
+    for (size_t base = 0; base < n; base += KEVLAR_BATCH) {
+        size_t m = n - base < KEVLAR_BATCH ? n - base : KEVLAR_BATCH;
+
+        // decrypt the batch, derive its tags and re-encrypt it under fresh salts for storage
+        for (size_t j = 0; j < m; j++) {
+            key_blocks[j] = in_keys[base + j].encrypted_state;
+            value_blocks[j] = in_values[base + j].encrypted_state;
+        }
+        auth = decrypt_batch(key_blocks, plain_keys, m, key_valid) && auth;
+        auth = decrypt_batch(value_blocks, plain_values, m, value_valid) && auth;
+        prf_tags(plain_keys, tag, m);
+        encrypt_batch(plain_keys, key_blocks, m);
+        encrypt_batch(plain_values, value_blocks, m);
+
+        reserve_for(m);
+        for (size_t j = 0; j < m; j++)
+            __builtin_prefetch(&tags[home(tag[j])], 1);
+
+        for (size_t j = 0; j < m; j++) {
+            if (!key_valid[j] || !value_valid[j])
+                continue;
+            size_t i = probe(tag[j], plain_keys[j], auth);
+            if (!tags[i]) {
+                tags[i] = tag[j];
+                keys[i].encrypted_state = key_blocks[j];
+                count++;
+                new_keys++;
+            }
+            values[i].encrypted_state = value_blocks[j];
+        }
+    }
+    wipe_bytes(plain_keys, sizeof(plain_keys));
+    wipe_bytes(plain_values, sizeof(plain_values));
+    if (inserted)
+        *inserted = new_keys;
+    return auth;
+}
+
+bool
+EncHashMap::find_batch(const EncInt *in_keys, EncInt *out_values, bool *found, size_t n,
+                       size_t *hits) const
+{
+    restore_key_registers();
+    bool auth = true;
+    size_t total = 0;
+    uint64_t plain_keys[KEVLAR_BATCH], stored[KEVLAR_BATCH], tag[KEVLAR_BATCH];
+    size_t slot[KEVLAR_BATCH], which[KEVLAR_BATCH];
+    __m128i blocks[KEVLAR_BATCH];
+    bool key_valid[KEVLAR_BATCH], valid[KEVLAR_BATCH];
+    size_t mask = tags.size() - 1;
+
+    for (size_t base = 0; base < n; base += KEVLAR_BATCH) {
+        size_t m = n - base < KEVLAR_BATCH ? n - base : KEVLAR_BATCH;
+
+        // decrypt the probe keys, derive their tags and prefetch their home buckets
+        for (size_t j = 0; j < m; j++)
+            blocks[j] = in_keys[base + j].encrypted_state;
+        auth = decrypt_batch(blocks, plain_keys, m, key_valid) && auth;
+        prf_tags(plain_keys, tag, m);
+        for (size_t j = 0; j < m; j++) {
+            __builtin_prefetch(&tags[home(tag[j])]);
+            __builtin_prefetch(&keys[home(tag[j])]);
+        }
+
+        // candidate slot: the first tag match, or the empty slot ending the probe sequence; probe keys
+        // that failed authentication are misses
+        size_t k = 0;
+        for (size_t j = 0; j < m; j++) {
+            found[base + j] = false;
+            if (!key_valid[j])
+                continue;
+            size_t i = home(tag[j]);
+            while (tags[i] && tags[i] != tag[j])
+                i = (i + 1) & mask;
+            slot[j] = i;
+            if (tags[i]) {
+                blocks[k] = keys[i].encrypted_state;
+                which[k++] = j;
+            }
+        }
+
+        // confirm the candidates with one batched decrypt; a 63-bit tag collision falls back to probe()
+        auth = decrypt_batch(blocks, stored, k, valid) && auth;
+        for (size_t c = 0; c < k; c++) {
+            size_t j = which[c];
+            if (!valid[c] || stored[c] != plain_keys[j])
+                slot[j] = probe(tag[j], plain_keys[j], auth);
+        }
+
+        // hand back the hits re-encrypted under fresh salts, dropping stored values that fail
+        size_t h = 0;
+        for (size_t j = 0; j < m; j++) {
+            if (key_valid[j] && tags[slot[j]]) {
+                blocks[h] = values[slot[j]].encrypted_state;
+                which[h++] = j;
+            }
+        }
+        auth = decrypt_batch(blocks, stored, h, valid) && auth;
+        encrypt_batch(stored, blocks, h);
+        for (size_t c = 0; c < h; c++) {
+            if (valid[c]) {
+                found[base + which[c]] = true;
+                out_values[base + which[c]].encrypted_state = blocks[c];
+                total++;
+            }
+        }
+    }
+    wipe_bytes(plain_keys, sizeof(plain_keys));
+    wipe_bytes(stored, sizeof(stored));
+    if (hits)
+        *hits = total;
+    return auth;
+}
+
+// --- EncIndex ---
+
+bool
+resolve_indices(const EncIndex *idx, size_t n, size_t bound, const void *base, size_t stride,
+                uint64_t *slots, bool for_write)
+{
+    restore_key_registers();
+    const uint8_t *bytes = static_cast<const uint8_t *>(base);
+    bool auth = true, in_bounds = true;
+    for (size_t i = 0; i < n; i += 4) {
+        size_t m = n - i < 4 ? n - i : 4;
+        __m128i b[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (size_t j = 0; j < m; j++)
+            b[j] = idx[i + j].encrypted_state;
+        AES_128_Dec_Raw4(b);
+        for (size_t j = 0; j < m; j++) {
+            uint64_t index = _mm_extract_epi64(b[j], 1);
+            bool cookie = _mm_cvtsi128_si32(b[j]) == 0x2a;
+            bool below = index < bound;
+            auth &= cookie;
+            in_bounds &= below;
+            slots[i + j] = (cookie & below) ? index : bound;
+        }
+    }
+    for (size_t j = 0; j < n; j++) {
+        if (slots[j] < bound) {
+            if (for_write)
+                __builtin_prefetch(bytes + slots[j] * stride, 1);
+            else
+                __builtin_prefetch(bytes + slots[j] * stride, 0);
+        }
+    }
+    if (!auth)
+        printf("Authentication failure...\n");
+    if (!in_bounds)
+        printf("Bounds check failure...\n");
+    return auth && in_bounds;
+}
+
+bool
+gather(const EncInt *base, size_t bound, const EncIndex *idx, size_t n, EncInt *out)
+{
+    restore_key_registers();
+    bool ok = true;
+    uint64_t slots[KEVLAR_BATCH], values[KEVLAR_BATCH];
+    __m128i blocks[KEVLAR_BATCH];
+    bool valid[KEVLAR_BATCH];
+    for (size_t b = 0; b < n; b += KEVLAR_BATCH) {
+        size_t m = n - b < KEVLAR_BATCH ? n - b : KEVLAR_BATCH;
+        ok = resolve_indices(idx + b, m, bound, base, sizeof(EncInt), slots, false) && ok;
+        size_t k = 0;
+        for (size_t j = 0; j < m; j++) {
+            if (slots[j] < bound)
+                blocks[k++] = base[slots[j]].encrypted_state;
+        }
+        ok = decrypt_batch(blocks, values, k, valid) && ok;
+        encrypt_batch(values, blocks, k);
+        k = 0;
+        for (size_t j = 0; j < m; j++) {
+            // an element failing authentication is never re-encrypted into a valid one
+            if (slots[j] < bound && valid[k])
+                out[b + j].encrypted_state = blocks[k];
+            else
+                out[b + j] = EncInt();
+            if (slots[j] < bound)
+                k++;
+        }
+    }
+    wipe_bytes(slots, sizeof(slots));
+    wipe_bytes(values, sizeof(values));
+    return ok;
+}
+
+bool
+scatter(EncInt *base, size_t bound, const EncIndex *idx, size_t n, const EncInt *in)
+{
+    restore_key_registers();
+    bool ok = true;
+    uint64_t slots[KEVLAR_BATCH], values[KEVLAR_BATCH];
+    __m128i blocks[KEVLAR_BATCH];
+    bool valid[KEVLAR_BATCH];
+    for (size_t b = 0; b < n; b += KEVLAR_BATCH) {
+        size_t m = n - b < KEVLAR_BATCH ? n - b : KEVLAR_BATCH;
+        ok = resolve_indices(idx + b, m, bound, base, sizeof(EncInt), slots, true) && ok;
+        for (size_t j = 0; j < m; j++)
+            blocks[j] = in[b + j].encrypted_state;
+        ok = decrypt_batch(blocks, values, m, valid) && ok;
+        encrypt_batch(values, blocks, m);
+        for (size_t j = 0; j < m; j++) {
+            // an element failing authentication leaves its target untouched
+            if (slots[j] < bound && valid[j])
+                base[slots[j]].encrypted_state = blocks[j];
+        }
+    }
+    wipe_bytes(slots, sizeof(slots));
+    wipe_bytes(values, sizeof(values));
+    return ok;
+}
+
+} // namespace kevlar
+
+// Static function with constructor attribute
+static void __attribute__((constructor)) load_time_init()
+{
+    // std::cout << "Initialization routine running..." << std::endl;
+    // call crypto library initialization function
+    kevlar::init_ephemeral_key();
+}
+
+#if 0
+extern "C" __attribute__((naked)) void __authfail() {
+  printf("Authentication failure...\n");
+  return;
+}
+#endif
@@ -4,7 +4,6 @@
 #include <cstdint>
 #include <cassert>
 #include <iostream>
-#include <random>
 #include <cstring>
 #include <wmmintrin.h>
 #include <emmintrin.h>
@@ -12,22 +11,17 @@
 #include <tmmintrin.h>
 #include <immintrin.h>  // Required for _rdseed32_step and _rdseed64_step
 #include <type_traits>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/types.h>
 
 typedef __int128 int128_t;
 typedef unsigned __int128 uint128_t;
 
-void
-print_m128i(const char *varname, __m128i value)
-{
-    uint8_t bytes[16];
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), value);
-
-    printf("%s: ", varname);
-    for (int i = 0; i < 16; i++) {
-        printf("%02x", bytes[i]);  // Print as hexadecimal
-    }
-    printf("\n");
-}
+void print_m128i(const char *varname, __m128i value);
 
 namespace kevlar {
 
@@ -36,9 +30,9 @@ namespace kevlar {
 // A global ephemeral 128-bit key is generated on first use along with its AES-128 key schedule.
 // We store only the encryption key schedule (ephemeral_enc_keys) and use it (in reverse order)
 // for decryption.
-static __m128i ephemeral_enc_keys[11];
-static __m128i ephemeral_key;
-static bool ephemeral_key_initialized = false;
+extern __m128i ephemeral_enc_keys[11];
+extern __m128i ephemeral_key;
+extern bool ephemeral_key_initialized;
 
 // Global register variables for keys 0-9.
 // These are bound to XMM registers xmm0 through xmm9 and will persist throughout execution.
@@ -55,85 +49,78 @@ volatile register __m128i g_key8  asm("xmm13");
 volatile register __m128i g_key9  asm("xmm14");
 volatile register __m128i g_key10 asm("xmm15");
 
-// Macro for AES-128 key expansion step. RC must be an immediate constant.
-#define AES128_KEY_EXPANSION_STEP(KEY, RC) ({                      \
-    __m128i _key = (KEY);                                          \
-    __m128i _temp = _mm_aeskeygenassist_si128(_key, (RC));         \
-    _temp = _mm_shuffle_epi32(_temp, _MM_SHUFFLE(3,3,3,3));          \
-    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
-    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
-    _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4));             \
-    _mm_xor_si128(_key, _temp);                                      \
-})
-
-#define _my_rdrand64_step(x) ({ unsigned char err; asm volatile(".byte 0x48; .byte 0x0f; .byte 0xc7; .byte 0xf0; setc %1":"=a"(*x), "=qm"(err)); err; })
+// --- Salt Leases ---
+//
+// Forked children inherit the key schedule and the salt register, so a parent and its children would
+// otherwise hand out identical salts. The salt lane (lane 1) of every plaintext block is therefore split
+// into a lease id in its high bits and a KEVLAR_SALT_COUNTER_BITS-bit counter below it. A process
+// encrypts under one lease at a time: when the counter wraps the cipher core calls renew_salt_lease()
+// for the next lease from a MAP_SHARED allocator mapped before the first fork, and each forked child
+// takes a lease of its own. Leases are handed out in order, so within a key domain no lease is held
+// twice and no process revisits a salt.
+//
+// The salt budget is per key domain rather than per process: 2^32 salts shared by all of its processes,
+// each fork and each restore_key_registers() that finds xmm14 clobbered discarding at most the rest of
+// one lease. Once all KEVLAR_SALT_LEASES leases have been handed out the allocator wraps (lease 0 is
+// never used) and salts may repeat, as the single 32-bit counter did after 2^32 encryptions.
+#define KEVLAR_SALT_COUNTER_BITS 16
+#define KEVLAR_SALT_LEASES       (1u << (32 - KEVLAR_SALT_COUNTER_BITS))
+
+// State shared by the processes of a key domain.
+struct SaltLeaseTable {
+    std::atomic<uint32_t> next_lease;
+    std::atomic<uint64_t> bytes_nonce;  // next EncBytes stream nonce
+};
 
+extern SaltLeaseTable *salt_leases;
+extern uint32_t salt_lease;
 
-extern "C" void
-init_ephemeral_key(void)
-{
-    if (!ephemeral_key_initialized) {
-        int success;
-        long long unsigned rdrand_value;
-        while (!(success =  _my_rdrand64_step(&rdrand_value)));
-        // printf("rdrand_value = 0x%lx\n", (uint64_t)rdrand_value);
-        std::mt19937 gen((uint64_t)rdrand_value);
-        std::uniform_int_distribution<uint32_t> dis;
-        uint32_t randomParts[4] = { dis(gen), dis(gen), dis(gen), dis(gen) };
-        // printf("randomParts[] = { %08x, %08x, %08x, %08x }\n", randomParts[3], randomParts[2], randomParts[1], randomParts[0]);
-        ephemeral_key = _mm_set_epi32(randomParts[3], randomParts[2], randomParts[1], randomParts[0]);
-
-        ephemeral_enc_keys[0] = ephemeral_key;
-        ephemeral_enc_keys[1] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[0], 0x01);
-        ephemeral_enc_keys[2] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[1], 0x02);
-        ephemeral_enc_keys[3] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[2], 0x04);
-        ephemeral_enc_keys[4] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[3], 0x08);
-        ephemeral_enc_keys[5] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[4], 0x10);
-        ephemeral_enc_keys[6] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[5], 0x20);
-        ephemeral_enc_keys[7] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[6], 0x40);
-        ephemeral_enc_keys[8] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[7], 0x80);
-        ephemeral_enc_keys[9] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[8], 0x1B);
-        ephemeral_enc_keys[10] = AES128_KEY_EXPANSION_STEP(ephemeral_enc_keys[9], 0x36);
-
-        // Bind the first 10 keys to XMM registers.
-        g_key0 = ephemeral_enc_keys[0];
-        g_key1 = ephemeral_enc_keys[1];
-        g_key2 = ephemeral_enc_keys[2];
-        g_key3 = ephemeral_enc_keys[3];
-        g_key4 = ephemeral_enc_keys[4];
-        g_key5 = ephemeral_enc_keys[5];
-        g_key6 = ephemeral_enc_keys[6];
-        g_key7 = ephemeral_enc_keys[7];
-        g_key8 = ephemeral_enc_keys[8];
-        g_key9 = ephemeral_enc_keys[9];
-        g_key10 = ephemeral_enc_keys[10];
-
-        // xmm14 is the incrementing salt value
-        __m128i salt_value = _mm_set_epi32(0, 0, dis(gen), 0);
-        g_key9 = salt_value;
-
-        // xmm13 is the incrementor value
-        __m128i salt_increment = _mm_set_epi32(0, 0, 1, 0);
-        g_key8 = salt_increment;
-
-#if 0
-        for (unsigned i=0; i <= 10; i++)
-          print_m128i("key[]", ephemeral_enc_keys[i]);
-        ephemeral_key_initialized = true;
-#endif
-    }
-}
+// Move to the next salt lease, restarting the counter at its beginning.
+extern "C" void renew_salt_lease(void);
 
+// The cipher core is defined inline in this header so that it is inlined into callers in every
+// translation unit: GCC cannot stream global register variables through LTO, so link-time inlining
+// out of libkevlar is not an option.
 register uint64_t value_arg asm("rbx");
 register uint64_t auth_arg asm("rcx");
-extern "C" /*inline*/ __m128i AES_128_Enc_Block(/* value_arg */);
-extern "C" /*inline*/ /* __m128i */ void AES_128_Dec_Block(__m128i block);
+extern "C" inline __m128i AES_128_Enc_Block(/* value_arg */);
+extern "C" inline /* __m128i */ void AES_128_Dec_Block(__m128i block);
+
+// Generate the ephemeral key and pin its schedule, run once at load time.
+extern "C" void init_ephemeral_key(void);
+
+// Reload the XMM-pinned key schedule from ephemeral_enc_keys. The running salt counter is kept if xmm14
+// still holds it, otherwise the process moves to a fresh salt lease.
+//
+// The cipher state lives in xmm4-xmm15 for the life of the process. Build every translation unit that
+// is linked with libkevlar with KEVLAR_CXXFLAGS from the Makefile (`make cxxflags`), so compiled code
+// leaves those registers alone. Code built without them, including libc and libstdc++, may still
+// clobber them on any call. libkevlar's out-of-line entry points call restore_key_registers() on entry,
+// but the inline EncInt operations in this header cannot: after calling into such code, call it before
+// the next inline EncInt operation.
+extern "C" void restore_key_registers(void);
+
+// Step the salt counter in xmm14, moving to a fresh lease when it wraps.
+extern "C" inline void
+step_salt(void)
+{
+    int counter;
+    __asm__ volatile (
+        "paddd   %%xmm13, %%xmm14  \n\t" // salt = salt + 1
+        "pextrw  $2, %%xmm14, %0   \n\t" // low 16 bits of the salt lane
+        : "=r" (counter)
+    );
+    if (__builtin_expect(counter == 0, 0))
+        renew_salt_lease();
+}
 
 // AES-128 encryption: iterate forward over ephemeral_enc_keys.
 // register uint64_t value_arg asm("rbx");
-extern "C" /*inline*/ __m128i
+extern "C" inline __m128i
 AES_128_Enc_Block(/* value_arg */)
 {
+  step_salt();
+
   // build the plaintext 128-bit word
   register __m128i block asm("xmm0")
      = _mm_set_epi32(static_cast<int>(value_arg >> 32),
@@ -142,8 +129,8 @@ AES_128_Enc_Block(/* value_arg */)
 
   // mix in the salt value
   __asm__ volatile (
-     "paddd   %xmm13, %xmm14    \n\t" // salt = salt + 1
-     "paddd   %xmm14, %xmm0     \n\t" // mix in the salt
+     "paddd   %%xmm14, %0       \n\t" // mix in the salt
+     : "+x" (block)
   );
 
   __asm__ volatile (
@@ -166,7 +153,7 @@ AES_128_Enc_Block(/* value_arg */)
 
 // AES-128 decryption: iterate in reverse order, applying inverse MixColumns on intermediate keys.
 // register uint64_t auth_arg asm("rcx");
-extern "C" /*inline*/ /* __m128i */ void
+extern "C" inline /* __m128i */ void
 AES_128_Dec_Block(__m128i block)
 {
     __asm__ volatile (
@@ -200,10 +187,12 @@ AES_128_Dec_Block(__m128i block)
 
     // check the authentication "cookie"
     __asm__ volatile (
-       "movd %xmm0, %ebx     \n\t" // Move lowest 32-bit lane into EBX
-       "cmpq $0x2a, %rbx     \n\t" // Compare with 42
-       "sete %cl            \n\t" // Set CL to 1 if not equal, 0 if equal
-       "movzx %cl, %rcx      \n\t" // Zero-extend CL into ECX
+       "movd %0, %%ebx       \n\t" // Move lowest 32-bit lane into EBX
+       "cmpq $0x2a, %%rbx    \n\t" // Compare with 42
+       "sete %%cl            \n\t" // Set CL to 1 if not equal, 0 if equal
+       "movzx %%cl, %%rcx    \n\t" // Zero-extend CL into ECX
+       :
+       : "x" (block)
    );
 
     uint32_t low = _mm_extract_epi32(block, 2);
@@ -211,6 +200,109 @@ AES_128_Dec_Block(__m128i block)
     value_arg = (static_cast<uint64_t>(high) << 32) | low;
 }
 
+// --- Raw Block Cipher ---
+//
+// The EncInt entry points above build their plaintext block from value_arg. The raw entry points below
+// encrypt caller-built blocks under the same reduced-round pinned key schedule, with no salt mixed in.
+// Each use keeps its blocks disjoint from EncInt blocks (cookie 42) with its own cookie in lane 0.
+#define KEVLAR_CTR_COOKIE  0x2b  // EncBytes keystream blocks
+#define KEVLAR_TAG_COOKIE  0x2c  // EncBytes chunk tag pads
+#define KEVLAR_NH_COOKIE   0x2d  // NH hash key derivation
+#define KEVLAR_PRF_COOKIE  0x2e  // EncHashMap key tags
+
+// Apply one AES round instruction with the key in XMM register KEY to asm operands %0-%3.
+#define KEVLAR_AES_ROUND4(OP, KEY)              \
+    OP " %%" KEY ", %0  \n\t"                   \
+    OP " %%" KEY ", %1  \n\t"                   \
+    OP " %%" KEY ", %2  \n\t"                   \
+    OP " %%" KEY ", %3  \n\t"
+
+// The full forward cipher over asm operands %0-%3, rounds interleaved so the four blocks pipeline.
+#define KEVLAR_AES_ENC4                         \
+    KEVLAR_AES_ROUND4("pxor", "xmm5")           \
+    KEVLAR_AES_ROUND4("aesenc", "xmm6")         \
+    KEVLAR_AES_ROUND4("aesenc", "xmm7")         \
+    KEVLAR_AES_ROUND4("aesenc", "xmm8")         \
+    KEVLAR_AES_ROUND4("aesenc", "xmm9")         \
+    KEVLAR_AES_ROUND4("aesenc", "xmm10")        \
+    KEVLAR_AES_ROUND4("aesenc", "xmm11")        \
+    KEVLAR_AES_ROUND4("aesenclast", "xmm15")
+
+// The inverse cipher over asm operands %0-%3, each decryption round key is derived once into xmm4 and
+// shared by the four blocks.
+#define KEVLAR_AES_DEC4                         \
+    KEVLAR_AES_ROUND4("pxor", "xmm15")          \
+    "aesimc %%xmm11, %%xmm4  \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    "aesimc %%xmm10, %%xmm4  \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    "aesimc %%xmm9, %%xmm4   \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    "aesimc %%xmm8, %%xmm4   \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    "aesimc %%xmm7, %%xmm4   \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    "aesimc %%xmm6, %%xmm4   \n\t"              \
+    KEVLAR_AES_ROUND4("aesdec", "xmm4")         \
+    KEVLAR_AES_ROUND4("aesdeclast", "xmm5")
+
+// Step the salt counter and return it in lane 1, lease id in its high bits. The other lanes are zero.
+extern "C" inline __m128i
+next_salt_block(void)
+{
+    __m128i salt;
+    step_salt();
+    __asm__ volatile (
+        "movdqa  %%xmm14, %0       \n\t"
+        : "=x" (salt)
+    );
+    return salt;
+}
+
+// Encrypt a single caller-built block.
+extern "C" inline __m128i
+AES_128_Enc_Raw(__m128i block)
+{
+    __asm__ volatile (
+        "pxor   %%xmm5, %0        \n\t"
+        "aesenc %%xmm6, %0        \n\t"
+        "aesenc %%xmm7, %0        \n\t"
+        "aesenc %%xmm8, %0        \n\t"
+        "aesenc %%xmm9, %0        \n\t"
+        "aesenc %%xmm10, %0       \n\t"
+        "aesenc %%xmm11, %0       \n\t"
+        "aesenclast %%xmm15, %0   \n\t"
+        : "+x" (block)
+    );
+    return block;
+}
+
+// Encrypt four caller-built blocks in place, pipelined.
+extern "C" inline void
+AES_128_Enc_Raw4(__m128i *blocks)
+{
+    __m128i b0 = blocks[0], b1 = blocks[1], b2 = blocks[2], b3 = blocks[3];
+    __asm__ volatile (
+        KEVLAR_AES_ENC4
+        : "+x" (b0), "+x" (b1), "+x" (b2), "+x" (b3)
+    );
+    blocks[0] = b0; blocks[1] = b1; blocks[2] = b2; blocks[3] = b3;
+}
+
+// Decrypt four blocks in place, pipelined.
+extern "C" inline void
+AES_128_Dec_Raw4(__m128i *blocks)
+{
+    __m128i b0 = blocks[0], b1 = blocks[1], b2 = blocks[2], b3 = blocks[3];
+    __asm__ volatile (
+        KEVLAR_AES_DEC4
+        : "+x" (b0), "+x" (b1), "+x" (b2), "+x" (b3)
+        :
+        : "xmm4"
+    );
+    blocks[0] = b0; blocks[1] = b1; blocks[2] = b2; blocks[3] = b3;
+}
+
 // --- EncInt Class ---
 //
 // EncInt supports all standard integral types (up to 64 bits). For types smaller than 64 bits,
@@ -460,6 +552,360 @@ public:
 #endif
 };
 
+// --- Batched EncInt Cipher ---
+//
+// Decrypt or encrypt n EncInt blocks four at a time through the pipelined cipher core, producing the
+// same blocks (cookie 42, fresh salt per block) as the one-at-a-time EncInt operations. decrypt_batch
+// returns false, after reporting it, if any block fails the cookie check, and if valid is given it
+// records which blocks passed. Bulk operations built on them work through their inputs KEVLAR_BATCH
+// elements at a time.
+#define KEVLAR_BATCH 16
+
+bool decrypt_batch(const __m128i *blocks, uint64_t *values, size_t n, bool *valid = nullptr);
+void encrypt_batch(const uint64_t *values, __m128i *blocks, size_t n);
+
+// Clear a plaintext scratch buffer in a way the optimizer cannot drop.
+void wipe_bytes(void *p, size_t n);
+
+// --- EncIndex ---
+//
+// An encrypted array index. It is an EncInt, so index arithmetic works as usual, but it is meant to be
+// consumed by gather() and scatter() rather than getValue(): plaintext indices then exist only in a
+// wiped batch buffer and in the address of the access itself. Those decrypt KEVLAR_BATCH indices at a
+// time through the pipelined cipher, fuse each index's cookie check with its bounds check, and prefetch
+// the targets before touching them. Elements whose index fails either check are skipped (gather yields
+// a zero value), the failure is reported and the call returns false. When scatter indices repeat, the
+// last write wins.
+class EncIndex : public EncInt {
+public:
+    EncIndex() {}
+    EncIndex(uint64_t i) : EncInt(i) {}
+    EncIndex(const EncInt &other) : EncInt(other) {}
+};
+
+static_assert(sizeof(EncIndex) == sizeof(__m128i), "EncIndex arrays must be arrays of cipher blocks");
+
+// Decrypt n <= KEVLAR_BATCH indices into slots, where an index that fails authentication or is not
+// below bound resolves to bound, and prefetch base + slot * stride for the valid ones. Returns false,
+// after reporting it, if any index was rejected.
+bool resolve_indices(const EncIndex *idx, size_t n, size_t bound, const void *base, size_t stride,
+                     uint64_t *slots, bool for_write);
+
+// out[i] = base[idx[i]] for i < n, over a plain array of bound elements.
+template<typename T>
+bool gather(const T *base, size_t bound, const EncIndex *idx, size_t n, T *out)
+{
+    bool ok = true;
+    uint64_t slots[KEVLAR_BATCH];
+    for (size_t b = 0; b < n; b += KEVLAR_BATCH) {
+        size_t m = n - b < KEVLAR_BATCH ? n - b : KEVLAR_BATCH;
+        ok = resolve_indices(idx + b, m, bound, base, sizeof(T), slots, false) && ok;
+        for (size_t j = 0; j < m; j++)
+            out[b + j] = slots[j] < bound ? base[slots[j]] : T();
+    }
+    wipe_bytes(slots, sizeof(slots));
+    return ok;
+}
+
+// base[idx[i]] = in[i] for i < n, over a plain array of bound elements.
+template<typename T>
+bool scatter(T *base, size_t bound, const EncIndex *idx, size_t n, const T *in)
+{
+    bool ok = true;
+    uint64_t slots[KEVLAR_BATCH];
+    for (size_t b = 0; b < n; b += KEVLAR_BATCH) {
+        size_t m = n - b < KEVLAR_BATCH ? n - b : KEVLAR_BATCH;
+        ok = resolve_indices(idx + b, m, bound, base, sizeof(T), slots, true) && ok;
+        for (size_t j = 0; j < m; j++) {
+            if (slots[j] < bound)
+                base[slots[j]] = in[b + j];
+        }
+    }
+    wipe_bytes(slots, sizeof(slots));
+    return ok;
+}
+
+// EncInt arrays: elements move re-encrypted under fresh salts, as EncInt copies do. An element that
+// fails authentication is dropped like a bad index: gather yields EncInt() and scatter leaves the target
+// untouched.
+bool gather(const EncInt *base, size_t bound, const EncIndex *idx, size_t n, EncInt *out);
+bool scatter(EncInt *base, size_t bound, const EncIndex *idx, size_t n, const EncInt *in);
+
+// --- EncIntArray ---
+//
+// A non-owning view over a contiguous run of EncInt values, e.g. one carved out of a SharedDomain arena.
+class EncIntArray {
+    EncInt *elems;
+    size_t count;
+
+public:
+    EncIntArray() : elems(nullptr), count(0) {}
+    EncIntArray(EncInt *e, size_t n) : elems(e), count(n) {}
+
+    EncInt &operator[](size_t i) { return elems[i]; }
+    const EncInt &operator[](size_t i) const { return elems[i]; }
+    size_t size() const { return count; }
+    EncInt *data() { return elems; }
+    EncInt *begin() { return elems; }
+    EncInt *end() { return elems + count; }
+};
+
+// --- SharedDomain ---
+//
+// An explicit shared-key domain: a MAP_SHARED arena created by one process before it forks its workers.
+// Every process forked from the creator afterwards shares the ephemeral key (each with its own salt
+// lease), so EncInt values allocated from the arena are read and updated in place by any member,
+// with no copying. Each 16-byte element store is a single aligned store, but concurrent writers to the
+// same element must still synchronize externally.
+class SharedDomain {
+    std::atomic<size_t> used;
+    size_t capacity;
+    size_t mapping_bytes;
+
+    static constexpr size_t header_bytes = 64;
+
+    SharedDomain(size_t cap, size_t bytes) : used(0), capacity(cap), mapping_bytes(bytes) {}
+
+    uint8_t *arena() { return reinterpret_cast<uint8_t *>(this) + header_bytes; }
+
+public:
+    // Map a new domain with room for arena_bytes of allocations, nullptr on failure.
+    static SharedDomain *create(size_t arena_bytes);
+
+    // Unmap the domain in the calling process; other members keep their mappings.
+    void destroy() {
+        munmap(this, mapping_bytes);
+    }
+
+    // Bump-allocate 16-byte aligned storage visible to all members, nullptr when the arena is exhausted.
+    void *allocate(size_t bytes);
+
+    // Allocate n EncInt values, each initialized to an encrypted zero.
+    EncIntArray make_array(size_t n);
+
+    size_t bytes_used() const { return used.load(); }
+    size_t bytes_capacity() const { return capacity; }
+};
+
+// --- EncHashMap ---
+//
+// An open-addressing hash map from EncInt keys to EncInt values. Salted ciphertexts cannot be hashed or
+// compared, so each slot also holds a 64-bit keyed-PRF tag of its plaintext key, the low half of
+// E(cookie, key) under the ephemeral key. The tag picks the home bucket and screens probes: a stored key
+// is decrypted only on a tag match, to confirm it. Rehashing needs only the tags. The batched entry
+// points decrypt probe keys and compute their tags four at a time through the pipelined cipher, prefetch
+// the home buckets, and re-encrypt results in bulk.
+class EncHashMap {
+    // A stored EncInt ciphertext. Unlike EncInt it has no constructor, so empty slots are plain zeroed
+    // blocks rather than a fresh encryption of 0 each.
+    struct StoredBlock {
+        __m128i encrypted_state;
+    };
+
+    std::vector<uint64_t> tags;    // 0 marks an empty slot, live tags have the low bit set
+    std::vector<StoredBlock> keys;
+    std::vector<StoredBlock> values;
+    size_t count;
+
+    size_t home(uint64_t tag) const { return (tag >> 1) & (tags.size() - 1); }
+    void reserve_for(size_t n);
+    size_t probe(uint64_t tag, uint64_t key, bool &auth) const;
+
+public:
+    explicit EncHashMap(size_t capacity = 16);
+
+    size_t size() const { return count; }
+    size_t capacity() const { return tags.size(); }
+
+    // Insert or overwrite. Returns true if key was not already present, false if it was or if the pair
+    // failed authentication (and was not stored).
+    bool insert(const EncInt &key, const EncInt &value);
+    // Copy the value stored under key (re-encrypted) into value. Returns false if absent or if key or
+    // the stored entry failed authentication.
+    bool find(const EncInt &key, EncInt &value) const;
+
+    // Batched forms, which like gather/scatter return false, after reporting it, if any element failed
+    // authentication. insert_batch skips pairs that fail and stores the rest, counting new keys in
+    // *inserted. found[i] reports whether keys[i] was present and authenticated, and find_batch counts
+    // the hits in *hits; values[i] is written only for hits.
+    bool insert_batch(const EncInt *keys, const EncInt *values, size_t n, size_t *inserted = nullptr);
+    bool find_batch(const EncInt *keys, EncInt *values, bool *found, size_t n,
+                    size_t *hits = nullptr) const;
+};
+
+// --- EncBytes ---
+//
+// Authenticated encryption for byte buffers and strings. Data is encrypted in CTR mode under the pinned
+// key schedule. Each stream draws a 64-bit nonce from a counter shared by the whole key domain, separate
+// from the 32-bit EncInt salt, so nonces never repeat across processes or wrap. Keystream and pad blocks
+// hold the cookie in byte 0, the nonce in bytes 1-8 and a 56-bit field in bytes 9-15: the block counter
+// for keystream blocks, and the chunk index, final-chunk flag and chunk length for pad blocks. The
+// buffer is cut into KEVLAR_BYTES_CHUNK-byte chunks and each chunk carries a 128-bit Wegman-Carter tag
+// NH(ciphertext) + E(pad). A chunk is verified before it is decrypted, so unauthenticated plaintext is
+// never released.
+#define KEVLAR_BYTES_CHUNK      4096
+#define KEVLAR_BYTES_MAX_CHUNKS (1ull << 34)
+
+// NH hash key, one 64-bit word per 8 bytes of a chunk, derived from the ephemeral key so that every
+// process sharing the key verifies the same tags.
+extern uint64_t nh_keys[KEVLAR_BYTES_CHUNK / 8];
+
+extern "C" void derive_nh_keys(void);
+
+// Draw a fresh stream nonce block: nonce in place, cookie and field bytes zero.
+__m128i next_bytes_nonce(void);
+
+// Minimal stand-in for C++20 std::span<uint8_t>: a mutable, non-owning view of caller memory, so
+// buffers can be sealed and opened in place.
+struct ByteSpan {
+    uint8_t *data;
+    size_t size;
+
+    ByteSpan() : data(nullptr), size(0) {}
+    ByteSpan(void *d, size_t n) : data(static_cast<uint8_t *>(d)), size(n) {}
+    ByteSpan(std::string &s) : data(reinterpret_cast<uint8_t *>(&s[0])), size(s.size()) {}
+    ByteSpan subspan(size_t offset, size_t n) const { return ByteSpan(data + offset, n); }
+};
+
+// One 128-bit chunk tag. Wrapped in a struct so that containers of tags keep __m128i's alignment
+// (std::vector<__m128i> drops it with -Wignored-attributes).
+struct ChunkTag {
+    __m128i value;
+};
+
+// --- ByteStream ---
+//
+// A streaming sealer/opener bound to one nonce. Calls process whole chunks and emit (or check) one tag
+// per chunk; every call but the last must cover a multiple of KEVLAR_BYTES_CHUNK bytes, and the last is
+// made with final set so that truncating the stream fails authentication.
+class ByteStream {
+    __m128i nonce;
+    uint64_t chunk;
+
+    __m128i ctr_base() const {
+        return _mm_or_si128(nonce, _mm_set_epi64x(0, KEVLAR_CTR_COOKIE));
+    }
+
+public:
+    // Seal under a fresh nonce.
+    ByteStream() : nonce(next_bytes_nonce()), chunk(0) {}
+    // Open (or resume) the stream sealed under nonce n.
+    explicit ByteStream(__m128i n) : nonce(n), chunk(0) {}
+
+    __m128i get_nonce() const { return nonce; }
+
+    // Number of tags a call over len bytes produces; an empty final call still authenticates the end.
+    static size_t tag_count(size_t len, bool final = true) {
+        size_t n = (len + KEVLAR_BYTES_CHUNK - 1) / KEVLAR_BYTES_CHUNK;
+        return (final && n == 0) ? 1 : n;
+    }
+
+    // Encrypt len bytes from in to out (which may alias) and write tag_count(len, final) tags.
+    void seal(const uint8_t *in, uint8_t *out, size_t len, ChunkTag *tags, bool final = true);
+    void seal(ByteSpan buf, ChunkTag *tags, bool final = true) {
+        seal(buf.data, buf.data, buf.size, tags, final);
+    }
+
+    // Verify and decrypt len bytes from in to out (which may alias). Stops at the first chunk that
+    // fails authentication, leaving it and the rest of out untouched.
+    bool open(const uint8_t *in, uint8_t *out, size_t len, const ChunkTag *tags, bool final = true);
+    bool open(ByteSpan buf, const ChunkTag *tags, bool final = true) {
+        return open(buf.data, buf.data, buf.size, tags, final);
+    }
+};
+
+// --- EncBytes Class ---
+//
+// An encrypted, authenticated byte buffer. As with EncInt, copies are re-encrypted under a fresh nonce.
+class EncBytes {
+protected:
+    std::vector<uint8_t> cipher;
+    std::vector<ChunkTag> tags;
+    __m128i nonce;
+
+    void seal_from(const uint8_t *p, size_t n);
+
+    // Re-encrypt other under a fresh nonce a chunk at a time, so at most one chunk is ever in the clear.
+    // If other fails authentication, its ciphertext, tags and nonce are copied unchanged instead.
+    void reseal_from(const EncBytes &other);
+
+public:
+    EncBytes() {
+        seal_from(nullptr, 0);
+    }
+    EncBytes(const void *p, size_t n) {
+        seal_from(static_cast<const uint8_t *>(p), n);
+    }
+    EncBytes(const EncBytes &other) {
+        reseal_from(other);
+    }
+    EncBytes &operator=(const EncBytes &other) {
+        if (this != &other)
+            reseal_from(other);
+        return *this;
+    }
+    // Moves steal the buffers and leave other sealed as an empty buffer, never without tags.
+    EncBytes(EncBytes &&other) : cipher(std::move(other.cipher)), tags(std::move(other.tags)),
+                                 nonce(other.nonce) {
+        other.seal_from(nullptr, 0);
+    }
+    EncBytes &operator=(EncBytes &&other) {
+        if (this != &other) {
+            cipher = std::move(other.cipher);
+            tags = std::move(other.tags);
+            nonce = other.nonce;
+            other.seal_from(nullptr, 0);
+        }
+        return *this;
+    }
+
+    // Replace the contents, encrypting under a fresh nonce.
+    void assign(const void *p, size_t n) {
+        seal_from(static_cast<const uint8_t *>(p), n);
+    }
+
+    size_t size() const { return cipher.size(); }
+
+    // Decrypt straight into caller memory, out.size must be at least size(). On authentication failure
+    // out is cleared and false is returned.
+    bool decrypt(ByteSpan out) const;
+
+    // Getters.
+    std::vector<uint8_t> getValue() const {
+        std::vector<uint8_t> plain(cipher.size());
+        decrypt(ByteSpan(plain.data(), plain.size()));
+        return plain;
+    }
+
+    // Constant-time comparison against a plaintext buffer; only the lengths leak through timing.
+    bool equals(const void *p, size_t n) const;
+
+    // Constant-time comparison of two encrypted buffers; only the lengths leak through timing.
+    friend bool ct_equal(const EncBytes &a, const EncBytes &b);
+
+    // Read-only view of the ciphertext, e.g. for storing or shipping it as-is.
+    const uint8_t *ciphertext() const { return cipher.data(); }
+};
+
+// --- EncString Class ---
+class EncString : public EncBytes {
+public:
+    EncString() {}
+    EncString(const std::string &s) : EncBytes(s.data(), s.size()) {}
+    EncString(const char *s) : EncBytes(s, strlen(s)) {}
+
+    // Getters.
+    std::string getValue() const {
+        std::string plain(size(), '\0');
+        decrypt(ByteSpan(plain));
+        return plain;
+    }
+
+    bool equals(const std::string &s) const {
+        return EncBytes::equals(s.data(), s.size());
+    }
+};
+
 #if 0
 // Convenience alias template.
 template<typename T>
@@ -478,20 +924,5 @@ using enc_uint64_t = EncInt_t<uint64_t>;
 
 } // namespace kevlar
 
-// Static function with constructor attribute
-static void __attribute__((constructor)) load_time_init()
-{
-    // std::cout << "Initialization routine running..." << std::endl;
-    // call crypto library initialization function
-    kevlar::init_ephemeral_key();
-}
-
-#if 0
-extern "C" __attribute__((naked)) void __authfail() {
-  printf("Authentication failure...\n");
-  return;
-}
-#endif
-
 #endif // KEVLAR_H
 
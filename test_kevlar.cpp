@@ -5,6 +5,11 @@
 #include <cassert>
 #include <limits>
 #include <type_traits>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace kevlar;
 
@@ -223,6 +228,262 @@ int main()
 #endif
   }
 
+  // Fork-aware salt leases and EncInt arrays shared through a SharedDomain.
+  {
+    std::cout << "Testing SharedDomain across fork()\n";
+
+    // libc calls above may have clobbered the pinned keys, re-pin them before sharing ciphertexts
+    restore_key_registers();
+
+    SharedDomain *domain = SharedDomain::create(64 * sizeof(EncInt));
+    assert(domain != nullptr);
+    EncIntArray shared = domain->make_array(4);
+    assert(shared.size() == 4);
+    assert(domain->make_array(64).size() == 0);  // arena exhausted
+    assert(domain->make_array(SIZE_MAX / sizeof(EncInt) + 2).size() == 0);  // size overflow
+    assert(domain->allocate(SIZE_MAX - 7) == nullptr);
+    shared[0] = EncInt(7);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      // child: update the shared array in place and report its salt lease
+      if (shared[0].getValue() != 7)
+        _exit(1);
+      shared[1] = shared[0] + EncInt(1);
+      shared[2] = EncInt(salt_lease);
+      _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    restore_key_registers();
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(shared[1].getValue() == 8);
+    assert(shared[2].getValue() != salt_lease);
+    assert(shared[3].getValue() == 0);
+    domain->destroy();
+  }
+
+  // A wrapping salt counter moves to a fresh lease instead of repeating ciphertexts.
+  {
+    std::cout << "Testing salt lease renewal\n";
+    restore_key_registers();
+    uint32_t lease = salt_lease;
+    EncInt first(7);
+    for (unsigned i = 0; i < (1u << KEVLAR_SALT_COUNTER_BITS) - 1; i++)
+      EncInt filler(1);
+    EncInt again(7);
+    assert(salt_lease != lease);
+    assert(memcmp(&first.encrypted_state, &again.encrypted_state, sizeof(__m128i)) != 0);
+    assert(again.getValue() == 7 && first.getValue() == 7);
+  }
+
+  // EncBytes/EncString authenticated encryption.
+  {
+    std::cout << "Testing EncBytes\n";
+
+    const size_t lengths[] = { 0, 1, 15, 16, 63, 64, 65, 4095, 4096, 4097, 3 * 4096 + 100 };
+    for (size_t len : lengths) {
+      std::vector<uint8_t> plain(len);
+      for (size_t i = 0; i < len; i++)
+        plain[i] = static_cast<uint8_t>(i * 7 + 3);
+
+      EncBytes eb(plain.data(), plain.size());
+      assert(eb.size() == len);
+      assert(eb.getValue() == plain);
+      assert(eb.equals(plain.data(), plain.size()));
+
+      // copies are re-encrypted under a fresh nonce
+      EncBytes copy = eb;
+      assert(copy.getValue() == plain);
+      assert(ct_equal(eb, copy));
+      if (len)
+        assert(memcmp(eb.ciphertext(), copy.ciphertext(), len) != 0);
+
+      if (len) {
+        plain[len / 2] ^= 0x10;
+        assert(!eb.equals(plain.data(), plain.size()));
+        EncBytes other(plain.data(), plain.size());
+        assert(!ct_equal(eb, other));
+
+        // a flipped ciphertext bit fails authentication and releases nothing
+        const_cast<uint8_t *>(eb.ciphertext())[len / 2] ^= 0x10;
+        std::vector<uint8_t> out(len, 0xff);
+        assert(!eb.decrypt(ByteSpan(out.data(), out.size())));
+        assert(out == std::vector<uint8_t>(len, 0));
+
+        // and so does a copy of it
+        EncBytes tampered = eb;
+        assert(!tampered.decrypt(ByteSpan(out.data(), out.size())));
+      }
+    }
+
+    // streaming, in place, and truncation detection
+    std::vector<uint8_t> buf(3 * 4096 + 10), orig;
+    for (size_t i = 0; i < buf.size(); i++)
+      buf[i] = static_cast<uint8_t>(i);
+    orig = buf;
+    std::vector<ChunkTag> tags(4);
+    ByteStream sealer;
+    sealer.seal(ByteSpan(buf.data(), 2 * 4096), &tags[0], false);
+    sealer.seal(ByteSpan(buf.data() + 2 * 4096, buf.size() - 2 * 4096), &tags[2], true);
+    assert(buf != orig);
+    ByteStream truncated(sealer.get_nonce());
+    std::vector<uint8_t> head(buf.begin(), buf.begin() + 2 * 4096);
+    assert(!truncated.open(ByteSpan(head.data(), head.size()), &tags[0], true));
+    ByteStream opener(sealer.get_nonce());
+    assert(opener.open(ByteSpan(buf.data(), buf.size()), &tags[0], true));
+    assert(buf == orig);
+    ByteStream next;
+    assert(_mm_movemask_epi8(_mm_cmpeq_epi8(next.get_nonce(), sealer.get_nonce())) != 0xffff);
+
+    EncString es("secret-token");
+    assert(es.getValue() == "secret-token");
+    assert(es.equals("secret-token"));
+    assert(!es.equals("secret-tokem"));
+    EncString es2 = es;
+    assert(es2.getValue() == "secret-token");
+    assert(ct_equal(es, es2));
+
+    // a moved-from buffer is left empty but still sealed
+    EncString es3 = std::move(es2);
+    assert(es3.getValue() == "secret-token");
+    assert(es2.size() == 0 && es2.getValue() == "");
+    EncString es4 = es2;
+    assert(es4.equals(""));
+    es4 = std::move(es3);
+    assert(es4.getValue() == "secret-token" && es3.equals(""));
+
+    // single-core throughput
+    std::vector<uint8_t> big(64 << 20);
+    std::vector<ChunkTag> big_tags(ByteStream::tag_count(big.size()));
+    auto start = std::chrono::steady_clock::now();
+    ByteStream bulk;
+    bulk.seal(ByteSpan(big.data(), big.size()), big_tags.data());
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  EncBytes seal throughput: " << big.size() / secs / 1e9 << " GB/s\n";
+  }
+
+  // EncHashMap with batched probing.
+  {
+    std::cout << "Testing EncHashMap\n";
+
+    restore_key_registers();
+
+    EncHashMap map;
+    assert(map.insert(EncInt(3), EncInt(30)));
+    assert(!map.insert(EncInt(3), EncInt(33)));  // overwrite
+    EncInt v;
+    assert(map.find(EncInt(3), v) && v.getValue() == 33);
+    assert(!map.find(EncInt(6), v));
+
+    const size_t n = 100000;
+    std::vector<EncInt> keys, vals;
+    for (size_t i = 0; i < n; i++) {
+      keys.push_back(EncInt(i * 3 + 1));
+      vals.push_back(EncInt(i * 7));
+    }
+    size_t inserted, hits;
+    assert(map.insert_batch(keys.data(), vals.data(), n, &inserted) && inserted == n);
+    assert(map.size() == n + 1);
+    assert(map.capacity() * 3 >= map.size() * 4);
+
+    // probe present and absent keys, including duplicates within one batch
+    std::vector<EncInt> probes, out(2 * n);
+    for (size_t i = 0; i < n; i++) {
+      probes.push_back(EncInt(i * 3 + 1));
+      probes.push_back(EncInt(i * 3 + 2));
+    }
+    std::unique_ptr<bool[]> found(new bool[2 * n]);
+    auto start = std::chrono::steady_clock::now();
+    assert(map.find_batch(probes.data(), out.data(), found.get(), 2 * n, &hits) && hits == n);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < n; i++) {
+      assert(found[2 * i] && out[2 * i].getValue() == i * 7);
+      assert(!found[2 * i + 1]);
+    }
+    std::cout << "  EncHashMap find_batch: " << 2 * n / secs / 1e6 << " M probes/s\n";
+
+    // stored ciphertexts are never handed out as-is
+    assert(map.find(EncInt(1), v));
+    EncInt w;
+    assert(map.find(EncInt(1), w));
+    assert(memcmp(&v.encrypted_state, &w.encrypted_state, sizeof(__m128i)) != 0);
+
+    // elements failing authentication are skipped and reported, the rest of the batch goes through
+    EncInt bad_keys[3] = { EncInt(1000000000), EncInt(1000000003), EncInt(1000000006) };
+    EncInt bad_vals[3] = { EncInt(1), EncInt(2), EncInt(3) };
+    bad_keys[1].encrypted_state = _mm_xor_si128(bad_keys[1].encrypted_state, _mm_set_epi64x(0, 1));
+    assert(!map.insert_batch(bad_keys, bad_vals, 3, &inserted) && inserted == 2);
+    assert(map.size() == n + 3);
+    EncInt bad_out[3];
+    bool bad_found[3];
+    assert(!map.find_batch(bad_keys, bad_out, bad_found, 3, &hits) && hits == 2);
+    assert(bad_found[0] && !bad_found[1] && bad_found[2]);
+    assert(bad_out[2].getValue() == 3);
+    assert(!map.find(bad_keys[1], v));
+  }
+
+  // EncIndex gather/scatter.
+  {
+    std::cout << "Testing EncIndex gather/scatter\n";
+
+    restore_key_registers();
+
+    // permute a plain table through encrypted indices, then scatter it back
+    const size_t n = 1 << 16;
+    std::vector<uint32_t> table(n), permuted(n), restored(n);
+    std::vector<EncIndex> perm;
+    for (size_t i = 0; i < n; i++) {
+      table[i] = static_cast<uint32_t>(i * 2654435761u);
+      perm.push_back(EncIndex((i * 40503) % n));  // odd multiplier: a permutation of [0, n)
+    }
+    auto start = std::chrono::steady_clock::now();
+    assert(gather(table.data(), n, perm.data(), n, permuted.data()));
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < n; i++)
+      assert(permuted[i] == table[(i * 40503) % n]);
+    assert(scatter(restored.data(), n, perm.data(), n, permuted.data()));
+    assert(restored == table);
+    std::cout << "  gather: " << n / secs / 1e6 << " M indices/s\n";
+
+    // EncInt tables move re-encrypted
+    std::vector<EncInt> enc_table, enc_out(8), enc_back(8);
+    std::vector<EncIndex> idx;
+    for (size_t i = 0; i < 8; i++) {
+      enc_table.push_back(EncInt(100 + i));
+      idx.push_back(EncIndex(7 - i));
+    }
+    assert(gather(enc_table.data(), 8, idx.data(), 8, enc_out.data()));
+    for (size_t i = 0; i < 8; i++)
+      assert(enc_out[i].getValue() == 107 - i);
+    assert(memcmp(&enc_out[0].encrypted_state, &enc_table[7].encrypted_state, sizeof(__m128i)) != 0);
+    assert(scatter(enc_back.data(), 8, idx.data(), 8, enc_out.data()));
+    for (size_t i = 0; i < 8; i++)
+      assert(enc_back[i].getValue() == 100 + i);
+
+    // out-of-bounds indices are rejected, not followed
+    EncIndex bad[2] = { EncIndex(3), EncIndex(n) };
+    uint32_t got[2] = { 1, 1 };
+    assert(!gather(table.data(), n, bad, 2, got));
+    assert(got[0] == table[3] && got[1] == 0);
+    uint32_t vals[2] = { 5, 6 };
+    assert(!scatter(restored.data(), n, bad, 2, vals));
+    assert(restored[3] == 5);
+
+    // tampered EncInt elements are dropped, never laundered into valid ciphertexts
+    EncInt tampered[2] = { EncInt(42), EncInt(43) };
+    tampered[0].encrypted_state = _mm_xor_si128(tampered[0].encrypted_state, _mm_set_epi64x(0, 1));
+    EncIndex targets[2] = { EncIndex(2), EncIndex(5) };
+    assert(!scatter(enc_back.data(), 8, targets, 2, tampered));
+    assert(enc_back[2].getValue() == 102 && enc_back[5].getValue() == 43);
+    enc_table[4].encrypted_state = _mm_xor_si128(enc_table[4].encrypted_state, _mm_set_epi64x(1, 0));
+    EncIndex sources[2] = { EncIndex(4), EncIndex(6) };
+    assert(!gather(enc_table.data(), 8, sources, 2, enc_out.data()));
+    assert(enc_out[0].getValue() == 0 && enc_out[1].getValue() == 106);
+  }
+
   register __m128i g_temp  asm("xmm4");
   register __m128i g_key0  asm("xmm5");
   register __m128i g_key1  asm("xmm6");